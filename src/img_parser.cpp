@@ -1,13 +1,29 @@
 #include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <nlohmann/json.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 struct Setting {
     /**
@@ -20,6 +36,16 @@ struct Setting {
      * The maximum height of the input image when displayed in GUI.
      */
     int image_display_max_height = 800;
+    /**
+     * Whether to detect vertical lines only in the region containing
+     * the text detected by OCR, instead of the whole image.
+     */
+    bool crop_to_text_extent = false;
+    /**
+     * The margin added around the text region when cropping.
+     * The unit is the height of the program input image.
+     */
+    float text_extent_margin = 0.02;
 };
 
 Setting read_settings(const std::string& filename) {
@@ -54,6 +80,20 @@ Setting read_settings(const std::string& filename) {
     } else {
         std::cout << "  image display max height: " << setting.image_display_max_height << "\n";
     }
+
+    // The following settings are optional, for settings files
+    // written before they were added.
+    setting.crop_to_text_extent = settings_json.value("crop_to_text_extent", false);
+    std::cout << "  crop to text extent: " << setting.crop_to_text_extent << "\n";
+
+    setting.text_extent_margin = settings_json.value("text_extent_margin", 0.02f);
+    if (setting.text_extent_margin < 0) {
+        std::cout << "  設定值 text extent margin 無效, 改設為0.02\n"
+                  << "  (Invalid value for text extent margin. Set to 0.02)\n";
+        setting.text_extent_margin = 0.02;
+    } else {
+        std::cout << "  text extent margin: " << setting.text_extent_margin << "\n";
+    }
     
     return setting;
 }
@@ -141,9 +181,15 @@ struct BoundingBox {
 struct Paragraph {
     BoundingBox bb;
     std::string text;
+    /**
+     * Index of the row containing the paragraph, set by merge().
+     * -1 if the paragraph is not merged from rows.
+     */
+    int row_index = -1;
     void reset() {
         bb.reset();
         text.clear();
+        row_index = -1;
     }
 };
 
@@ -221,6 +267,11 @@ std::vector<ParagraphGroup> split(const ParagraphGroup& in_group, bool split_x)
     auto in_paragraphs = in_group.get_paragraphs();
     std::sort(in_paragraphs.begin(), in_paragraphs.end(), less);
 
+    // Without paragraphs there is no group, not one empty group.
+    if (in_paragraphs.empty()) {
+        return out_groups;
+    }
+
     // Create the first group.
     out_groups.emplace_back();
     // Check each paragraph.
@@ -258,11 +309,12 @@ ParagraphGroup merge(const std::vector<ParagraphGroup>& in_groups,
         return out_group;
     }
 
-    // Add paragraphs to output.
+    // Add paragraphs to output. Record the row of each paragraph.
     for (int i = begin_index; i < end_index; ++i) {
         auto& in_group = in_groups[i];
-        for (auto&& paragraph : in_group.get_paragraphs()) {
-            out_group.push_back(paragraph);
+        for (auto paragraph : in_group.get_paragraphs()) {
+            paragraph.row_index = i;
+            out_group.push_back(std::move(paragraph));
         }
     }
 
@@ -270,40 +322,156 @@ ParagraphGroup merge(const std::vector<ParagraphGroup>& in_groups,
     return out_group;
 }
 
-std::vector<BoundingBox> detect_vertical_lines(const std::string& image_filename,
-    const Setting& setting) {
-    // Open the image file.
-    cv::Mat image = cv::imread(image_filename);
+/**
+ * Buffers reused by detect_vertical_lines() across images.
+ * A long-lived worker keeps one workspace so that processing a poster
+ * does not allocate multi-megabyte images again and again.
+ * The working buffers only grow, to the largest image seen so far.
+ * A smaller image uses a standalone image on the front of a buffer,
+ * not a region of interest in it. OpenCV filters read pixels outside
+ * a region of interest, which would be left over from earlier images.
+ */
+struct LineDetectionWorkspace {
+    // Encoded bytes of the image file.
+    std::vector<unsigned char> file_buffer;
+    // The decoded grayscale image.
+    cv::Mat gray_image;
+    // Bytes of the blurred image, its x and y derivatives,
+    // the edge image and the label image.
+    cv::Mat blur_buffer;
+    cv::Mat dx_buffer;
+    cv::Mat dy_buffer;
+    cv::Mat edge_buffer;
+    cv::Mat label_buffer;
+    // Structuring elements keyed by (width, height).
+    std::map<std::pair<int, int>, cv::Mat> structuring_elements;
+
+    /**
+     * Return a continuous image of the given size and type
+     * using the bytes of the buffer. The image does not own the bytes.
+     * Reallocate the buffer only if it is too small.
+     */
+    static cv::Mat acquire(cv::Mat& buffer, int rows, int cols, int type) {
+        size_t byte_count = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+        if (buffer.total() < byte_count) {
+            buffer.create(1, static_cast<int>(byte_count), CV_8UC1);
+        }
+        return cv::Mat(rows, cols, type, buffer.data);
+    }
+
+    const cv::Mat& get_rect_structure(int width, int height) {
+        auto key = std::make_pair(width, height);
+        auto it = structuring_elements.find(key);
+        if (it == structuring_elements.end()) {
+            it = structuring_elements.emplace(key, cv::getStructuringElement(
+                cv::MorphShapes::MORPH_RECT, cv::Size(width, height))).first;
+        }
+        return it->second;
+    }
+
+    /**
+     * Read the image file and decode it directly to grayscale.
+     * @return false if the file cannot be read or decoded.
+     */
+    bool decode_gray(const std::string& image_filename) {
+        // Never leave the previous image behind on failure.
+        std::ifstream image_file(image_filename, std::ios::binary);
+        image_file.seekg(0, std::ios::end);
+        auto file_size = image_file.tellg();
+        image_file.seekg(0, std::ios::beg);
+        if (!image_file || file_size <= 0) {
+            gray_image.release();
+            return false;
+        }
+        file_buffer.resize(static_cast<size_t>(file_size));
+        if (!image_file.read(reinterpret_cast<char*>(file_buffer.data()), file_size)) {
+            gray_image.release();
+            return false;
+        }
+
+        // Decode into the existing image, which is reused only when the size
+        // matches the previous image. The size is unknown before decoding,
+        // so the image cannot be a view of a pooled buffer like the others.
+        // imdecode() leaves the image untouched if decoding fails,
+        // so check the returned image instead.
+        if (cv::imdecode(file_buffer, cv::ImreadModes::IMREAD_GRAYSCALE, &gray_image).empty()) {
+            gray_image.release();
+            return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * Detect vertical lines in a grayscale image, which is usually
+ * the image decoded by LineDetectionWorkspace::decode_gray().
+ * @param region if not null, detect lines only in the region plus a margin
+ *   of setting.text_extent_margin. The output is still in image coordinates.
+ */
+std::vector<BoundingBox> detect_vertical_lines(const cv::Mat& gray_image,
+    const Setting& setting, LineDetectionWorkspace& workspace,
+    const BoundingBox* region = nullptr) {
+    // Lengths are relative to the height of the whole image even if cropped.
+    const int image_height = gray_image.rows;
+
+    // Crop the image to the region plus the margin.
+    int x_begin = 0;
+    int y_begin = 0;
+    int x_end = gray_image.cols;
+    int y_end = gray_image.rows;
+    if (region) {
+        int margin = setting.text_extent_margin * image_height;
+        x_begin = std::max(x_begin, region->min.x - margin);
+        y_begin = std::max(y_begin, region->min.y - margin);
+        x_end = std::min(x_end, region->max.x + margin + 1);
+        y_end = std::min(y_end, region->max.y + margin + 1);
+        if (x_begin >= x_end || y_begin >= y_end) {
+            // The region is empty or outside the image.
+            return {};
+        }
+    }
+    cv::Mat cropped_image = gray_image(cv::Rect(x_begin, y_begin,
+        x_end - x_begin, y_end - y_begin));
 
     // Detect edges.
-    cv::Mat edge_image;
-    cv::cvtColor(image, edge_image, cv::ColorConversionCodes::COLOR_BGR2GRAY);
-    cv::blur(edge_image, edge_image, cv::Size(3, 3));
+    // Canny() on an image would allocate its derivatives and a copy of the
+    // input on every call, so compute the derivatives into pooled buffers
+    // as Canny() does internally, and use the overload taking them.
+    const int rows = cropped_image.rows;
+    const int cols = cropped_image.cols;
+    cv::Mat blurred_image = LineDetectionWorkspace::acquire(workspace.blur_buffer,
+        rows, cols, CV_8UC1);
+    cv::Mat dx = LineDetectionWorkspace::acquire(workspace.dx_buffer, rows, cols, CV_16SC1);
+    cv::Mat dy = LineDetectionWorkspace::acquire(workspace.dy_buffer, rows, cols, CV_16SC1);
+    cv::Mat edge_image = LineDetectionWorkspace::acquire(workspace.edge_buffer,
+        rows, cols, CV_8UC1);
+    cv::blur(cropped_image, blurred_image, cv::Size(3, 3));
     int low_threshold = 5;
     int ratio = 3;
     int kernel_size = 3;
-    cv::Canny(edge_image, edge_image, low_threshold, ratio * low_threshold, kernel_size);
+    cv::Sobel(blurred_image, dx, CV_16S, 1, 0, kernel_size, 1, 0, cv::BORDER_REPLICATE);
+    cv::Sobel(blurred_image, dy, CV_16S, 0, 1, kernel_size, 1, 0, cv::BORDER_REPLICATE);
+    cv::Canny(dx, dy, edge_image, low_threshold, ratio * low_threshold);
 
     // Detect vertical line pixels.
-    cv::Mat vertical_structure = cv::getStructuringElement(cv::MorphShapes::MORPH_RECT,
-        cv::Size(1, setting.vertical_line_length_threshold * edge_image.rows));
-    cv::erode(edge_image, edge_image, vertical_structure, cv::Point(-1, -1));
-    cv::dilate(edge_image, edge_image, vertical_structure, cv::Point(-1, -1));
+    const cv::Mat* vertical_structure = &workspace.get_rect_structure(1,
+        setting.vertical_line_length_threshold * image_height);
+    cv::erode(edge_image, edge_image, *vertical_structure, cv::Point(-1, -1));
+    cv::dilate(edge_image, edge_image, *vertical_structure, cv::Point(-1, -1));
 
     // Merge nearby lines.
-    cv::Mat square_structure = cv::getStructuringElement(cv::MorphShapes::MORPH_RECT,
-        cv::Size(10, 10));
+    const cv::Mat& square_structure = workspace.get_rect_structure(10, 10);
     cv::dilate(edge_image, edge_image, square_structure, cv::Point(-1, -1));
     cv::erode(edge_image, edge_image, square_structure, cv::Point(-1, -1));
 
     // Merge vertical lines.
-    vertical_structure = cv::getStructuringElement(cv::MorphShapes::MORPH_RECT,
-        cv::Size(1, edge_image.rows / 10));
-    cv::dilate(edge_image, edge_image, vertical_structure, cv::Point(-1, -1));
-    cv::erode(edge_image, edge_image, vertical_structure, cv::Point(-1, -1));
+    vertical_structure = &workspace.get_rect_structure(1, image_height / 10);
+    cv::dilate(edge_image, edge_image, *vertical_structure, cv::Point(-1, -1));
+    cv::erode(edge_image, edge_image, *vertical_structure, cv::Point(-1, -1));
 
     // Label pixels of vertical lines by finding connected components.
-    cv::Mat labelled_image(edge_image.size(), CV_32S);
+    cv::Mat labelled_image = LineDetectionWorkspace::acquire(workspace.label_buffer,
+        edge_image.rows, edge_image.cols, CV_32S);
     int label_count = cv::connectedComponents(edge_image, labelled_image, 8);
 
     if (label_count <= 1) {
@@ -320,7 +488,8 @@ std::vector<BoundingBox> detect_vertical_lines(const std::string& image_filename
                 // Skip background pixels.
                 continue;
             }
-            vertical_line_bbs[label - 1].grow(Vector2(j, i));
+            // Translate back to image coordinates.
+            vertical_line_bbs[label - 1].grow(Vector2(x_begin + j, y_begin + i));
         }
     }
 
@@ -375,6 +544,31 @@ int get_vertical_line_interval_index(const std::vector<BoundingBox>& vertical_li
     return index;
 }
 
+/**
+ * Get the union of the bounding boxes of all symbols with text
+ * in the vision result.
+ */
+BoundingBox get_text_extent(const nlohmann::json& vision_result) {
+    BoundingBox extent;
+    if (!vision_result.contains("fullTextAnnotation")) return extent;
+    for (auto&& page : vision_result["fullTextAnnotation"]["pages"]) {
+        for (auto&& block : page["blocks"]) {
+            for (auto&& paragraph : block["paragraphs"]) {
+                for (auto&& word : paragraph["words"]) {
+                    for (auto&& symbol : word["symbols"]) {
+                        if (!symbol.contains("text")) continue;
+                        for (auto&& vertex : symbol["boundingBox"]["vertices"]) {
+                            // Vision omits a coordinate when it is 0.
+                            extent.grow(Vector2(vertex.value("x", 0), vertex.value("y", 0)));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return extent;
+}
+
 ParagraphGroup read_paragraphs(const nlohmann::json& vision_result,
     const std::string& image_filename,
     const std::vector<BoundingBox>& vertical_line_bbs) {
@@ -641,6 +835,159 @@ std::pair<int, int> find_best_row_range(const std::vector<ParagraphGroup>& parag
     return row_range_candidates.back();
 }
 
+/**
+ * Add a bounding box to the column extents of a group of paragraphs.
+ * The column extents are disjoint in x and sorted by min x. Each extent
+ * is the bounding box of a column that split(group, true) would produce,
+ * so the column count of a group can be updated without splitting again.
+ */
+void add_column_extent(std::vector<BoundingBox>& column_bbs, const BoundingBox& bb) {
+    // Skip the columns on the left of the bounding box.
+    auto it = column_bbs.begin();
+    while (it != column_bbs.end() && it->min.x < bb.min.x && !overlap_x(*it, bb)) {
+        ++it;
+    }
+
+    // Merge the columns overlapping the bounding box.
+    BoundingBox merged_bb = bb;
+    auto overlap_end = it;
+    while (overlap_end != column_bbs.end() && overlap_x(*overlap_end, merged_bb)) {
+        merged_bb.grow(*overlap_end);
+        ++overlap_end;
+    }
+    it = column_bbs.erase(it, overlap_end);
+    column_bbs.insert(it, merged_bb);
+}
+
+/**
+ * Segment rows into disjoint row ranges, each containing a table.
+ * Scan the rows once. A table is extended by the next row as long as
+ * the column count of the merged rows is not less than the column count
+ * of the table or that of the row. Otherwise, the row starts a new table.
+ * @param paragraph_rows assumed sorted by min y.
+ * @param min_column_count the minimum column count of a table.
+ * @param min_row_count the minimum row count of a table.
+ * @return pairs of {row_begin_index, row_end_index}, sorted by row index.
+ */
+std::vector<std::pair<int, int>> find_table_row_ranges(
+    const std::vector<ParagraphGroup>& paragraph_rows,
+    int min_column_count = 2, int min_row_count = 2) {
+    const int total_row_count = paragraph_rows.size();
+
+    // Calculate the column extents of each row.
+    std::vector<std::vector<BoundingBox>> row_column_bbs(total_row_count);
+    for (int i = 0; i < total_row_count; ++i) {
+        for (auto&& paragraph : paragraph_rows[i].get_paragraphs()) {
+            add_column_extent(row_column_bbs[i], paragraph.bb);
+        }
+    }
+
+    std::vector<std::pair<int, int>> row_ranges;
+    std::vector<BoundingBox> table_column_bbs;
+    std::vector<BoundingBox> extended_column_bbs;
+    int row_begin_index = 0;
+    while (row_begin_index < total_row_count) {
+        // Start a table with the row.
+        table_column_bbs = row_column_bbs[row_begin_index];
+        int row_end_index = row_begin_index + 1;
+
+        // Extend the table row by row.
+        while (row_end_index < total_row_count) {
+            auto& next_column_bbs = row_column_bbs[row_end_index];
+            extended_column_bbs = table_column_bbs;
+            for (auto&& bb : next_column_bbs) {
+                add_column_extent(extended_column_bbs, bb);
+            }
+            if (extended_column_bbs.size() < table_column_bbs.size() ||
+                extended_column_bbs.size() < next_column_bbs.size()) {
+                // The row breaks the columns of the table.
+                break;
+            }
+            table_column_bbs.swap(extended_column_bbs);
+            ++row_end_index;
+        }
+
+        // Keep the row range if it looks like a table.
+        if (table_column_bbs.size() >= min_column_count &&
+            row_end_index - row_begin_index >= min_row_count) {
+            row_ranges.push_back(std::make_pair(row_begin_index, row_end_index));
+        }
+
+        // The row that breaks the table may start the next table.
+        row_begin_index = row_end_index;
+    }
+
+    return row_ranges;
+}
+
+/**
+ * Merge rows in the range [row_begin_index, row_end_index) and
+ * split them into columns. Each column is sorted by y.
+ */
+std::vector<ParagraphGroup> split_columns(const std::vector<ParagraphGroup>& paragraph_rows,
+    int row_begin_index, int row_end_index) {
+    // Merge rows between the begin and end indices.
+    auto merged_group = merge(paragraph_rows, row_begin_index, row_end_index);
+
+    // Split the merged group into columns.
+    auto paragraph_columns = split(merged_group, true);
+
+    // Sort each column by y.
+    for (auto&& column : paragraph_columns) {
+        column.sort(false);
+    }
+
+    return paragraph_columns;
+}
+
+/**
+ * Memoize the columns of row ranges, so that switching between row ranges
+ * in an interactive session merges and splits each range only once.
+ * The rows must outlive the cache.
+ */
+class ColumnSplitCache {
+private:
+    const std::vector<ParagraphGroup>& paragraph_rows;
+    std::map<std::pair<int, int>, std::vector<ParagraphGroup>> columns_by_row_range;
+
+public:
+    explicit ColumnSplitCache(const std::vector<ParagraphGroup>& paragraph_rows):
+        paragraph_rows(paragraph_rows) {}
+    /**
+     * Get the columns of rows in the range [row_begin_index, row_end_index).
+     */
+    const std::vector<ParagraphGroup>& get_columns(int row_begin_index, int row_end_index) {
+        auto key = std::make_pair(row_begin_index, row_end_index);
+        auto it = columns_by_row_range.find(key);
+        if (it == columns_by_row_range.end()) {
+            it = columns_by_row_range.emplace(key,
+                split_columns(paragraph_rows, row_begin_index, row_end_index)).first;
+        }
+        return it->second;
+    }
+};
+
+struct Table {
+    int row_begin_index = 0;
+    int row_end_index = 0;
+    std::vector<ParagraphGroup> columns;
+};
+
+/**
+ * Find all tables in the rows and split each of them into columns.
+ */
+std::vector<Table> extract_tables(const std::vector<ParagraphGroup>& paragraph_rows) {
+    std::vector<Table> tables;
+    for (auto&& row_range : find_table_row_ranges(paragraph_rows)) {
+        Table table;
+        table.row_begin_index = row_range.first;
+        table.row_end_index = row_range.second;
+        table.columns = split_columns(paragraph_rows, row_range.first, row_range.second);
+        tables.push_back(std::move(table));
+    }
+    return tables;
+}
+
 void print(const ParagraphGroup& group) {
     for (auto&& paragraph : group.get_paragraphs()) {
         std::cout << paragraph.text << "\n";
@@ -670,9 +1017,13 @@ void show_image(const std::string& filename, const ParagraphGroup& paragraph_gro
     cv::waitKey(0);
 }
 
-void show_image(const std::string& filename, const std::vector<ParagraphGroup>& paragraph_groups,
+/**
+ * Show the image with the bounding box and the index of each row.
+ * The input image is not modified.
+ */
+void show_image(const cv::Mat& input_image, const std::vector<ParagraphGroup>& paragraph_groups,
     const Setting& setting) {
-    cv::Mat image = cv::imread(filename);
+    cv::Mat image = input_image.clone();
 
     // Draw bounding box of paragraphs.
     int row_index = 0;
@@ -701,128 +1052,1456 @@ void show_image(const std::string& filename, const std::vector<ParagraphGroup>&
     cv::waitKey(0);
 }
 
-int main(int argc, char** argv) {
-    // Parse input argument.
-    std::string image_filename;
-    if (argc == 2) {
-        image_filename = argv[1];
-    } else {
-        std::cout << "輸入參數無效 (Invalid input). 用法 (Usage): img_parser <image_filename>\n";
-        return -1;
-    }
-
-    // Read settings.json, which is assumed to be located in the working directory.
-    const auto setting = read_settings("./settings.json");
-
-    // Convert image filename to json filename by replacing the extension name.
-    auto json_filename = image_filename.substr(0, image_filename.find_last_of(".")) + ".json";
-
-    auto vertical_line_bbs = detect_vertical_lines(image_filename, setting);
-
-    // // Test
-    // std::cout << vertical_line_bbs.size() << "\n";
-    // BoundingBox bb;
-    // bb.grow(Vector2(1100, 1000));
-    // bb.grow(Vector2(1101, 1001));
-    // auto y_overlapping_vertical_line_bbs = get_y_overlapping_vertical_line_bbs(
-    //     vertical_line_bbs, bb);
-    // std::cout << y_overlapping_vertical_line_bbs.size() << "\n";
-    // auto index = get_vertical_line_interval_index(vertical_line_bbs, bb);
-    // std::cout << index << "\n";
-    // index = get_vertical_line_interval_index(y_overlapping_vertical_line_bbs, bb);
-    // std::cout << index << "\n";
-    // return 0;
+/**
+ * Convert image filename to json filename by replacing the extension name.
+ */
+std::string get_json_filename(const std::string& image_filename) {
+    return image_filename.substr(0, image_filename.find_last_of(".")) + ".json";
+}
 
+/**
+ * Read and parse the json file containing the vision result.
+ * @return false if the file cannot be read or parsed.
+ */
+bool read_vision_result(const std::string& json_filename, nlohmann::json& vision_result) {
     std::ifstream json_file(json_filename);
     if (!json_file.is_open()) {
         std::cout << "無法開啟json檔 (Cannot open json file): " << json_filename << "\n";
-        return -1;
+        return false;
+    }
+    vision_result = nlohmann::json::parse(json_file, nullptr, false);
+    if (vision_result.is_discarded()) {
+        std::cout << "無法解析json檔 (Cannot parse json file): " << json_filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Detect vertical lines in the image decoded in the workspace.
+ * Only the region around the text in the vision result is used
+ * if setting.crop_to_text_extent is true.
+ */
+std::vector<BoundingBox> detect_vertical_lines(const nlohmann::json& vision_result,
+    const Setting& setting, LineDetectionWorkspace& workspace) {
+    if (setting.crop_to_text_extent) {
+        auto text_extent = get_text_extent(vision_result);
+        return detect_vertical_lines(workspace.gray_image, setting, workspace, &text_extent);
+    }
+    return detect_vertical_lines(workspace.gray_image, setting, workspace);
+}
+
+/**
+ * Read paragraphs from the json file of the image with the help of
+ * vertical lines detected in the image, and split the paragraphs into rows.
+ * The json file has the same name as the image except the extension.
+ * @return false if the image or the json file cannot be read.
+ */
+bool read_paragraph_rows(const std::string& image_filename, const Setting& setting,
+    LineDetectionWorkspace& workspace, std::vector<ParagraphGroup>& paragraph_rows) {
+    auto json_filename = get_json_filename(image_filename);
+
+    // Open the image file as a grayscale image.
+    if (!workspace.decode_gray(image_filename)) {
+        std::cout << "無法開啟圖檔 (Cannot open image file): " << image_filename << "\n";
+        return false;
     }
+
     nlohmann::json vision_result;
-    json_file >> vision_result;
+    if (!read_vision_result(json_filename, vision_result)) {
+        return false;
+    }
 
-    // std::cout << "json_file.size(): " << vision_result.size() << "\n";
-    // std::cout << vision_result["fullTextAnnotation"]["text"] << "\n";
+    auto vertical_line_bbs = detect_vertical_lines(vision_result, setting, workspace);
 
     auto paragraph_group = read_paragraphs(vision_result, image_filename, vertical_line_bbs);
 
-    // std::cout << "read paragraphs:\n";
-    // print(paragraph_group);
-    // std::cout << "read completed\n\n";
-    // std::cout << "paragraph count: " << paragraph_group.get_paragraphs().size() << "\n";
+    // Split into rows.
+    paragraph_rows = split(paragraph_group, false);
+    return true;
+}
+
+/**
+ * A stable 64-bit FNV-1a hash of a string.
+ * Unlike std::hash, it gives the same value on every machine,
+ * so that all shards agree on which shard owns an image.
+ */
+uint64_t stable_hash(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
-    // // Sort by bb min y.
-    // paragraph_group.sort_min_y();
+/**
+ * List names of the files with the extension in the directory, sorted by name.
+ * The extension does not contain the dot, e.g. "png".
+ * @return false if the directory cannot be listed, e.g. it does not exist
+ *   or a shared filesystem is not mounted.
+ */
+bool list_image_filenames(const std::string& directory, const std::string& extension,
+    std::vector<std::string>& filenames) {
+    filenames.clear();
+    std::error_code error;
+    std::filesystem::directory_iterator it(directory, error);
+    for (; !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+        bool is_file = it->is_regular_file(error);
+        if (error) break;
+        if (!is_file) continue;
+        auto& path = it->path();
+        if (path.extension().string() != "." + extension) continue;
+        filenames.push_back(path.filename().string());
+    }
+    if (error) {
+        std::cout << "無法讀取資料夾 (Cannot list directory): " << directory
+                  << " (" << error.message() << ")\n";
+        return false;
+    }
+    std::sort(filenames.begin(), filenames.end());
+    return true;
+}
 
-    // Find table by brute force.
+/**
+ * Insert "<index>-of-<count>" before the extension of a filename,
+ * e.g. "results.jsonl" becomes "results.0-of-2.jsonl".
+ * The filename is unchanged if there is only one shard.
+ */
+std::string add_shard_suffix(const std::string& filename, int shard_index, int shard_count) {
+    if (shard_count == 1) return filename;
+    std::filesystem::path path(filename);
+    auto suffix = std::to_string(shard_index) + "-of-" + std::to_string(shard_count);
+    auto shard_filename = path.stem().string() + "." + suffix + path.extension().string();
+    return (path.parent_path() / shard_filename).string();
+}
 
-    // Split into rows.
-    auto paragraph_rows = split(paragraph_group, false);
+/**
+ * Convert extracted tables to a result record of an image,
+ * which is written as one line of a results file.
+ */
+nlohmann::json make_result_record(const std::string& image_name, bool succeeded,
+    const std::vector<Table>& tables) {
+    nlohmann::json record;
+    record["image"] = image_name;
+    record["status"] = succeeded ? "ok" : "failed";
+    record["tables"] = nlohmann::json::array();
+    for (auto&& table : tables) {
+        nlohmann::json table_record;
+        table_record["row_range"] = {table.row_begin_index, table.row_end_index};
+        table_record["columns"] = nlohmann::json::array();
+        for (auto&& column : table.columns) {
+            nlohmann::json column_texts = nlohmann::json::array();
+            for (auto&& paragraph : column.get_paragraphs()) {
+                column_texts.push_back(paragraph.text);
+            }
+            table_record["columns"].push_back(column_texts);
+        }
+        record["tables"].push_back(table_record);
+    }
+    return record;
+}
 
-    // std::cout << "\nRow count: " << paragraph_rows.size() << "\n\n";
-    // for (int i = 0; i < paragraph_rows.size(); ++i) {
-    //     std::cout << "Row " << i << ":\n\n";
-    //     print(paragraph_rows[i]);
-    //     std::cout << "\n";
-    // }
+/**
+ * Read the records of a results file written by batch one at a time.
+ * Incomplete lines, e.g. the last line of an interrupted shard, are skipped.
+ */
+class ResultsFileReader {
+private:
+    std::ifstream file;
+    bool has_record = false;
+    bool sorted = true;
+    std::string line;
+    std::string image_name;
+    bool succeeded = false;
 
-    // Show images with rows labelled.
-    show_image(image_filename, paragraph_rows, setting);
-
-    // Let user input row range.
-    bool row_range_is_specified_by_input = false;
-    int input_row_begin_index = 0;
-    int input_row_end_index = 0;
-    std::cout << "請輸入起始列 (Please input row begin index): ";
-    std::cin >> input_row_begin_index;
-    std::cout << "請輸入結束列 (Please input row end index): ";
-    std::cin >> input_row_end_index;
-    // Check input valid or not.
-    if (input_row_begin_index < 0 || input_row_end_index < 1 ||
-        input_row_begin_index >= paragraph_rows.size() || input_row_end_index > paragraph_rows.size() ||
-        input_row_begin_index >= input_row_end_index) {
-        std::cout << "輸入範圍無效, 嘗試自動尋找最佳範圍 "
-                  << "(Invalid input indices. Try to find the best row range.)\n";
-        row_range_is_specified_by_input = false;
-    } else {
-        row_range_is_specified_by_input = true;
+public:
+    explicit ResultsFileReader(const std::string& filename): file(filename) {
+        next();
+    }
+    bool is_open() const {
+        return file.is_open();
+    }
+    /**
+     * @return false at the end of the file.
+     */
+    bool has_next() const {
+        return has_record;
+    }
+    /**
+     * @return false if an image name is less than the previous one.
+     */
+    bool is_sorted() const {
+        return sorted;
+    }
+    // The line of the current record, as written by batch.
+    const std::string& get_line() const {
+        return line;
+    }
+    const std::string& get_image_name() const {
+        return image_name;
+    }
+    bool is_succeeded() const {
+        return succeeded;
+    }
+    /**
+     * Move to the next record.
+     */
+    void next() {
+        std::string next_line;
+        while (std::getline(file, next_line)) {
+            auto record = nlohmann::json::parse(next_line, nullptr, false);
+            if (record.is_discarded() || !record.contains("image") || !record["image"].is_string()) {
+                continue;
+            }
+            std::string next_image_name = record["image"];
+            if (has_record && next_image_name < image_name) {
+                sorted = false;
+            }
+            image_name = std::move(next_image_name);
+            succeeded = record.value("status", "") == "ok";
+            line = std::move(next_line);
+            has_record = true;
+            return;
+        }
+        has_record = false;
     }
+};
 
-    // Determine the row range to use.
-    int row_begin_index, row_end_index;
-    if (row_range_is_specified_by_input) {
-        // The row range is specified by user input.
-        row_begin_index = input_row_begin_index;
-        row_end_index = input_row_end_index;
-    } else {
-        // The row range is not specified by user input.
-        // Find best row range that maximizes the column count.
-        auto best_row_range = find_best_row_range(paragraph_rows);
-        row_begin_index = best_row_range.first;
-        row_end_index = best_row_range.second;
+/**
+ * A cell of an extracted table.
+ */
+struct Cell {
+    int table_index = 0;
+    // Index of the row in all rows of the image.
+    int row_index = 0;
+    // Index of the column in the table.
+    int column_index = 0;
+    BoundingBox bb;
+    std::string text;
+};
+
+/**
+ * Get the cells of the tables. The row index of a cell is the index
+ * of its row in all rows of the image, recorded by merge().
+ */
+std::vector<Cell> get_cells(const std::vector<Table>& tables) {
+    std::vector<Cell> cells;
+    for (int table_index = 0; table_index < tables.size(); ++table_index) {
+        auto& table = tables[table_index];
+        for (int column_index = 0; column_index < table.columns.size(); ++column_index) {
+            for (auto&& paragraph : table.columns[column_index].get_paragraphs()) {
+                Cell cell;
+                cell.table_index = table_index;
+                cell.column_index = column_index;
+                cell.bb = paragraph.bb;
+                cell.text = paragraph.text;
+                cell.row_index = paragraph.row_index;
+                cells.push_back(std::move(cell));
+            }
+        }
     }
+    return cells;
+}
 
-    std::cout << "將範圍 [" << row_begin_index << ", " << row_end_index << ") 內的列分割為行 "
-                << "(Split rows in range [" << row_begin_index << ", " << row_end_index << ") into columns):\n";
+/**
+ * A cell writer writes the cells of each image to a file for bulk loading.
+ * Cells are written image by image, so the whole corpus is never
+ * kept in memory.
+ */
+class CellWriter {
+public:
+    virtual ~CellWriter() = default;
+    virtual bool is_open() const = 0;
+    virtual void write(const std::string& image_name, const std::vector<Cell>& cells) = 0;
+};
 
-    // Merge rows between the begin and end indices.
-    auto merged_group = merge(paragraph_rows, row_begin_index, row_end_index);
-    // std::cout << "merged_group size: " << merged_group.get_paragraphs().size() << "\n";
+/**
+ * Write one json object per cell per line:
+ * {"image", "table", "row", "column", "bb": [min x, min y, max x, max y], "text"}
+ */
+class JsonLinesCellWriter : public CellWriter {
+private:
+    std::ofstream file;
 
-    // Split the merged group into columns.
-    auto paragraph_columns = split(merged_group, true);
-    // std::cout << "column count: " << paragraph_columns.size() << "\n";
+public:
+    explicit JsonLinesCellWriter(const std::string& filename): file(filename) {}
+    bool is_open() const override {
+        return file.is_open();
+    }
+    void write(const std::string& image_name, const std::vector<Cell>& cells) override {
+        for (auto&& cell : cells) {
+            nlohmann::json record;
+            record["image"] = image_name;
+            record["table"] = cell.table_index;
+            record["row"] = cell.row_index;
+            record["column"] = cell.column_index;
+            record["bb"] = {cell.bb.min.x, cell.bb.min.y, cell.bb.max.x, cell.bb.max.y};
+            record["text"] = cell.text;
+            file << record.dump() << "\n";
+        }
+        file.flush();
+    }
+};
 
-    // Sort each column by y.
-    for (auto&& column : paragraph_columns) {
-        column.sort(false);
+/**
+ * Write cells in a binary columnar format. All integers are little endian.
+ * The file starts with the magic "CIPC" and a uint32 version, 1.
+ * Each image with cells is a batch:
+ *   uint32 cell count n, uint32 image name length, image name bytes,
+ *   7 int32 columns of n values: table, row, column, min x, min y, max x, max y,
+ *   uint32 text offsets of n + 1 values, and the concatenated UTF-8 texts.
+ * Text i is bytes [offsets[i], offsets[i + 1]) of the texts.
+ */
+class ColumnarCellWriter : public CellWriter {
+private:
+    std::ofstream file;
+
+    void write_uint32(uint32_t value) {
+        char bytes[4] = {
+            static_cast<char>(value & 0xff), static_cast<char>((value >> 8) & 0xff),
+            static_cast<char>((value >> 16) & 0xff), static_cast<char>((value >> 24) & 0xff)};
+        file.write(bytes, 4);
+    }
+    template <typename Getter>
+    void write_int32_column(const std::vector<Cell>& cells, Getter get) {
+        for (auto&& cell : cells) {
+            write_uint32(static_cast<uint32_t>(get(cell)));
+        }
+    }
+
+public:
+    explicit ColumnarCellWriter(const std::string& filename):
+        file(filename, std::ios::binary) {
+        if (file.is_open()) {
+            file.write("CIPC", 4);
+            write_uint32(1);
+        }
+    }
+    bool is_open() const override {
+        return file.is_open();
     }
+    void write(const std::string& image_name, const std::vector<Cell>& cells) override {
+        if (cells.empty()) return;
+
+        write_uint32(cells.size());
+        write_uint32(image_name.size());
+        file.write(image_name.data(), image_name.size());
+
+        write_int32_column(cells, [](const Cell& cell) { return cell.table_index; });
+        write_int32_column(cells, [](const Cell& cell) { return cell.row_index; });
+        write_int32_column(cells, [](const Cell& cell) { return cell.column_index; });
+        write_int32_column(cells, [](const Cell& cell) { return cell.bb.min.x; });
+        write_int32_column(cells, [](const Cell& cell) { return cell.bb.min.y; });
+        write_int32_column(cells, [](const Cell& cell) { return cell.bb.max.x; });
+        write_int32_column(cells, [](const Cell& cell) { return cell.bb.max.y; });
+
+        uint32_t offset = 0;
+        write_uint32(offset);
+        for (auto&& cell : cells) {
+            offset += cell.text.size();
+            write_uint32(offset);
+        }
+        for (auto&& cell : cells) {
+            file.write(cell.text.data(), cell.text.size());
+        }
+        file.flush();
+    }
+};
 
-    // Print columns.
-    // std::cout << "\nColumn count: " << paragraph_columns.size() << "\n\n";
-    for (int i = 0; i < paragraph_columns.size(); ++i) {
-        std::cout << "\n";
-        print(paragraph_columns[i]);
+/**
+ * Read files written by ColumnarCellWriter, one image at a time.
+ */
+class ColumnarCellReader {
+private:
+    std::ifstream file;
+    std::streamoff file_size = 0;
+    bool header_is_valid = false;
+    bool truncated = false;
+
+    // Bytes from the current position to the end of the file.
+    uint64_t get_remaining_size() {
+        auto position = file.tellg();
+        return position < 0 ? 0 : static_cast<uint64_t>(file_size - position);
+    }
+    bool read_uint32(uint32_t& value) {
+        unsigned char bytes[4];
+        if (!file.read(reinterpret_cast<char*>(bytes), 4)) return false;
+        value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+        return true;
+    }
+    bool read_string(size_t size, std::string& text) {
+        text.resize(size);
+        return size == 0 || static_cast<bool>(file.read(&text[0], size));
+    }
+
+public:
+    explicit ColumnarCellReader(const std::string& filename): file(filename, std::ios::binary) {
+        file.seekg(0, std::ios::end);
+        file_size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        std::string magic;
+        uint32_t version = 0;
+        header_is_valid = file.is_open() && read_string(4, magic) && magic == "CIPC" &&
+            read_uint32(version) && version == 1;
+    }
+    bool is_valid() const {
+        return header_is_valid;
+    }
+    bool is_truncated() const {
+        return truncated;
+    }
+    /**
+     * Read the cells of the next image.
+     * @return false at the end of the file or if the file is truncated.
+     */
+    bool read(std::string& image_name, std::vector<Cell>& cells) {
+        if (!header_is_valid || file.peek() == std::char_traits<char>::eof()) return false;
+        // Any failure below means the batch is incomplete.
+        truncated = true;
+        // Sizes are checked against the rest of the file before allocating,
+        // since a corrupt or partly written batch may hold any value.
+        uint32_t cell_count = 0;
+        uint32_t image_name_size = 0;
+        if (!read_uint32(cell_count) || !read_uint32(image_name_size) ||
+            image_name_size > get_remaining_size() ||
+            !read_string(image_name_size, image_name)) {
+            return false;
+        }
+
+        // 7 int32 columns and n + 1 text offsets.
+        uint64_t column_size = (7 * static_cast<uint64_t>(cell_count) + cell_count + 1) * 4;
+        if (column_size > get_remaining_size()) return false;
+        cells.assign(cell_count, Cell());
+        auto read_int32_column = [&](int Cell::* member) {
+            for (auto&& cell : cells) {
+                uint32_t value;
+                if (!read_uint32(value)) return false;
+                cell.*member = static_cast<int32_t>(value);
+            }
+            return true;
+        };
+        auto read_vector2_column = [&](Vector2 BoundingBox::* corner, int Vector2::* axis) {
+            for (auto&& cell : cells) {
+                uint32_t value;
+                if (!read_uint32(value)) return false;
+                (cell.bb.*corner).*axis = static_cast<int32_t>(value);
+            }
+            return true;
+        };
+        if (!read_int32_column(&Cell::table_index) || !read_int32_column(&Cell::row_index) ||
+            !read_int32_column(&Cell::column_index) ||
+            !read_vector2_column(&BoundingBox::min, &Vector2::x) ||
+            !read_vector2_column(&BoundingBox::min, &Vector2::y) ||
+            !read_vector2_column(&BoundingBox::max, &Vector2::x) ||
+            !read_vector2_column(&BoundingBox::max, &Vector2::y)) {
+            return false;
+        }
+
+        std::vector<uint32_t> offsets(cell_count + 1);
+        for (auto&& offset : offsets) {
+            if (!read_uint32(offset)) return false;
+        }
+        std::string texts;
+        if (offsets.back() > get_remaining_size() || !read_string(offsets.back(), texts)) return false;
+        for (uint32_t i = 0; i < cell_count; ++i) {
+            if (offsets[i] > offsets[i + 1] || offsets[i + 1] > texts.size()) return false;
+            cells[i].text = texts.substr(offsets[i], offsets[i + 1] - offsets[i]);
+        }
+        truncated = false;
+        return true;
+    }
+};
+
+/**
+ * An OCR backend detects text in an image and writes the vision result
+ * to the json file read by read_paragraph_rows().
+ * detect() may be called from several threads at the same time.
+ */
+class OcrBackend {
+public:
+    virtual ~OcrBackend() = default;
+    /**
+     * @return false if the text cannot be detected.
+     */
+    virtual bool detect(const std::string& image_filename, const std::string& json_filename) = 0;
+};
+
+/**
+ * Split a command into arguments at whitespace.
+ * Quotes and other shell syntax are not interpreted.
+ */
+std::vector<std::string> split_command(const std::string& command) {
+    std::vector<std::string> arguments;
+    std::istringstream command_stream(command);
+    std::string argument;
+    while (command_stream >> argument) {
+        arguments.push_back(argument);
+    }
+    return arguments;
+}
+
+/**
+ * Start a process running the arguments without a shell, so that
+ * file names are never interpreted by a shell.
+ * @param io_fd if not negative, used as stdin and stdout of the process.
+ * @return the process id, or -1 if the process cannot be started.
+ */
+pid_t spawn_process(const std::vector<std::string>& arguments, int io_fd = -1) {
+    if (arguments.empty()) return -1;
+
+    // Prepare argv before fork, since only exec is safe in the child
+    // of a multithreaded process.
+    std::vector<char*> argv;
+    for (auto&& argument : arguments) {
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+    const long max_fd = sysconf(_SC_OPEN_MAX);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (io_fd >= 0) {
+            dup2(io_fd, STDIN_FILENO);
+            dup2(io_fd, STDOUT_FILENO);
+        }
+        // Do not pass other files of the parent, e.g. the results file
+        // or a worker's socket, to the process.
+        for (long fd = STDERR_FILENO + 1; fd < max_fd; ++fd) {
+            close(fd);
+        }
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * Run a command for each image, e.g. "node text_detector/detect.js",
+ * which calls the Vision API. The command is given the image filename
+ * as its last argument and is expected to write the json file next to
+ * the image. Each image starts a new process; WorkerOcrBackend avoids that.
+ */
+class CommandOcrBackend : public OcrBackend {
+private:
+    std::vector<std::string> arguments;
+
+public:
+    explicit CommandOcrBackend(const std::string& command): arguments(split_command(command)) {}
+    bool detect(const std::string& image_filename, const std::string& json_filename) override {
+        auto process_arguments = arguments;
+        process_arguments.push_back(image_filename);
+        pid_t pid = spawn_process(process_arguments);
+        if (pid < 0) return false;
+        int status = 0;
+        if (waitpid(pid, &status, 0) != pid) return false;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return false;
+        return std::filesystem::exists(json_filename);
+    }
+};
+
+/**
+ * Send images to one long-lived worker process, e.g.
+ * "node text_detector/detect_server.js", which keeps one Vision client
+ * for all images. The worker reads one image filename per line from stdin,
+ * writes the json file next to the image, and replies with a line
+ * "ok<TAB><image_filename>" or "error<TAB><image_filename>" on stdout.
+ * Requests are sent without waiting for earlier replies, so the worker
+ * may process several images at the same time. An image fails if its
+ * reply does not arrive within the timeout, and the worker is killed
+ * if it does not exit within the timeout after its stdin is closed.
+ */
+class WorkerOcrBackend : public OcrBackend {
+private:
+    pid_t pid = -1;
+    int socket_fd = -1;
+    std::chrono::milliseconds timeout;
+    std::thread reader_thread;
+    std::mutex mutex;
+    // Replies waited for, keyed by image filename.
+    std::map<std::string, std::promise<bool>> pending_replies;
+    bool worker_exited = false;
+
+    void read_replies() {
+        std::string buffer;
+        char chunk[4096];
+        while (true) {
+            auto size = read(socket_fd, chunk, sizeof(chunk));
+            if (size <= 0) break;
+            buffer.append(chunk, size);
+
+            // Handle complete lines.
+            size_t line_end;
+            while ((line_end = buffer.find('\n')) != std::string::npos) {
+                auto line = buffer.substr(0, line_end);
+                buffer.erase(0, line_end + 1);
+                auto tab_position = line.find('\t');
+                if (tab_position == std::string::npos) continue;
+                auto status = line.substr(0, tab_position);
+                auto image_filename = line.substr(tab_position + 1);
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = pending_replies.find(image_filename);
+                if (it == pending_replies.end()) continue;
+                it->second.set_value(status == "ok");
+                pending_replies.erase(it);
+            }
+        }
+
+        // The worker exited. Fail all waiting requests.
+        std::lock_guard<std::mutex> lock(mutex);
+        worker_exited = true;
+        for (auto&& pending_reply : pending_replies) {
+            pending_reply.second.set_value(false);
+        }
+        pending_replies.clear();
+    }
+
+public:
+    WorkerOcrBackend(const std::string& command, int timeout_milliseconds):
+        timeout(timeout_milliseconds) {
+        // Close-on-exec, so that no other process started by batch
+        // holds the socket open.
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+            worker_exited = true;
+            return;
+        }
+        pid = spawn_process(split_command(command), fds[1]);
+        close(fds[1]);
+        socket_fd = fds[0];
+        if (pid < 0) {
+            worker_exited = true;
+            return;
+        }
+        reader_thread = std::thread(&WorkerOcrBackend::read_replies, this);
+    }
+    ~WorkerOcrBackend() override {
+        // Close the worker's stdin. It exits after finishing its requests.
+        // Kill it if it hangs, so that the reader thread sees the end of file.
+        if (socket_fd >= 0) shutdown(socket_fd, SHUT_WR);
+        if (pid > 0) {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            while (waitpid(pid, nullptr, WNOHANG) == 0) {
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    std::cout << "OCR worker 逾時, 強制結束 (OCR worker timed out and is killed)\n";
+                    kill(pid, SIGKILL);
+                    waitpid(pid, nullptr, 0);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        if (reader_thread.joinable()) reader_thread.join();
+        if (socket_fd >= 0) close(socket_fd);
+    }
+    bool detect(const std::string& image_filename, const std::string& json_filename) override {
+        // A line break in the filename would break the protocol.
+        if (image_filename.find('\n') != std::string::npos) return false;
+
+        std::future<bool> reply;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (worker_exited || pending_replies.count(image_filename)) return false;
+            reply = pending_replies[image_filename].get_future();
+
+            // Send the request. MSG_NOSIGNAL avoids SIGPIPE if the worker died.
+            auto request = image_filename + "\n";
+            size_t sent_size = 0;
+            while (sent_size < request.size()) {
+                auto size = send(socket_fd, request.data() + sent_size,
+                    request.size() - sent_size, MSG_NOSIGNAL);
+                if (size <= 0) {
+                    pending_replies.erase(image_filename);
+                    return false;
+                }
+                sent_size += size;
+            }
+        }
+        // Stop waiting if the worker hangs or replies with another
+        // spelling of the filename. A late reply is ignored.
+        if (reply.wait_for(timeout) != std::future_status::ready) {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending_replies.erase(image_filename);
+            std::cout << "OCR逾時 (OCR timed out): " << image_filename << "\n";
+            return false;
+        }
+        return reply.get() && std::filesystem::exists(json_filename);
+    }
+};
+
+/**
+ * Replay vision results recorded in a directory, for testing the pipeline
+ * offline. The result of an image is the json file with the same basename
+ * in the replay directory. A latency can be added to each call to
+ * simulate requests to the Vision API.
+ */
+class ReplayOcrBackend : public OcrBackend {
+private:
+    std::string replay_directory;
+    int latency_milliseconds;
+
+public:
+    ReplayOcrBackend(const std::string& replay_directory, int latency_milliseconds):
+        replay_directory(replay_directory), latency_milliseconds(latency_milliseconds) {}
+    bool detect(const std::string& image_filename, const std::string& json_filename) override {
+        if (latency_milliseconds > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(latency_milliseconds));
+        }
+        auto recorded_filename = std::filesystem::path(replay_directory) /
+            std::filesystem::path(json_filename).filename();
+        std::error_code error;
+        std::filesystem::copy_file(recorded_filename, json_filename,
+            std::filesystem::copy_options::overwrite_existing, error);
+        return !error;
+    }
+};
+
+/**
+ * Parse a whole string as a decimal integer.
+ * Unlike std::atoi(), a typo such as "x" or "1x" is an error, not 0 or 1.
+ * @return false if the string is not an integer.
+ */
+bool parse_int(const std::string& text, int& value) {
+    auto text_end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), text_end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == text_end;
+}
+
+/**
+ * img_parser batch <image_directory> <extension> [--shard <index> <count>] [--output <filename>]
+ *     [--ocr-command <command> | --ocr-worker <command> [--ocr-timeout <milliseconds>] |
+ *      --ocr-replay <directory> [--ocr-latency <milliseconds>]]
+ *     [--max-in-flight <count>] [--cells <filename> [--cells-format jsonl|columnar]]
+ * Extract all tables of each image in the directory and write one result
+ * record per line to the results file. With --shard, only the images
+ * whose stable hash of the file name modulo count equals index are
+ * processed, so that shards can run on different machines without
+ * coordination. Each shard writes its own results and cells files, named
+ * with "<index>-of-<count>" before the extension, e.g. results.0-of-2.jsonl.
+ * With an OCR backend, images without a json file are sent to OCR in
+ * background threads while completed images are parsed, and at most
+ * max-in-flight images are waiting to be parsed.
+ * With --cells, the cells of the tables are also written to the file
+ * by a CellWriter, as JSON Lines (default) or in the columnar format.
+ */
+int run_batch(int argc, char** argv) {
+    // Parse input arguments.
+    if (argc < 4) {
+        std::cout << "輸入參數無效 (Invalid input). 用法 (Usage): img_parser batch "
+                  << "<image_directory> <extension> [--shard <index> <count>] [--output <filename>] "
+                  << "[--ocr-command <command> | --ocr-worker <command> [--ocr-timeout <milliseconds>] | "
+                  << "--ocr-replay <directory> [--ocr-latency <milliseconds>]] "
+                  << "[--max-in-flight <count>] [--cells <filename> [--cells-format jsonl|columnar]]\n";
+        return -1;
+    }
+    std::string image_directory = argv[2];
+    std::string extension = argv[3];
+    int shard_index = 0;
+    int shard_count = 1;
+    std::string results_filename;
+    std::string ocr_command;
+    std::string ocr_worker_command;
+    std::string ocr_replay_directory;
+    int ocr_latency_milliseconds = 0;
+    int ocr_timeout_milliseconds = 60000;
+    int max_in_flight_count = 4;
+    std::string cells_filename;
+    std::string cells_format = "jsonl";
+    for (int i = 4; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--shard" && i + 2 < argc) {
+            if (!parse_int(argv[i + 1], shard_index) || !parse_int(argv[i + 2], shard_count)) {
+                std::cout << "分片參數無效 (Invalid shard): " << argv[i + 1] << " " << argv[i + 2] << "\n";
+                return -1;
+            }
+            i += 2;
+        } else if (option == "--output" && i + 1 < argc) {
+            results_filename = argv[i + 1];
+            i += 1;
+        } else if (option == "--ocr-command" && i + 1 < argc) {
+            ocr_command = argv[i + 1];
+            i += 1;
+        } else if (option == "--ocr-worker" && i + 1 < argc) {
+            ocr_worker_command = argv[i + 1];
+            i += 1;
+        } else if (option == "--ocr-replay" && i + 1 < argc) {
+            ocr_replay_directory = argv[i + 1];
+            i += 1;
+        } else if (option == "--ocr-latency" && i + 1 < argc) {
+            if (!parse_int(argv[i + 1], ocr_latency_milliseconds)) {
+                std::cout << "輸入參數無效 (Invalid input): " << option << " " << argv[i + 1] << "\n";
+                return -1;
+            }
+            i += 1;
+        } else if (option == "--ocr-timeout" && i + 1 < argc) {
+            if (!parse_int(argv[i + 1], ocr_timeout_milliseconds) || ocr_timeout_milliseconds <= 0) {
+                std::cout << "輸入參數無效 (Invalid input): " << option << " " << argv[i + 1] << "\n";
+                return -1;
+            }
+            i += 1;
+        } else if (option == "--max-in-flight" && i + 1 < argc) {
+            if (!parse_int(argv[i + 1], max_in_flight_count)) {
+                std::cout << "輸入參數無效 (Invalid input): " << option << " " << argv[i + 1] << "\n";
+                return -1;
+            }
+            i += 1;
+        } else if (option == "--cells" && i + 1 < argc) {
+            cells_filename = argv[i + 1];
+            i += 1;
+        } else if (option == "--cells-format" && i + 1 < argc) {
+            cells_format = argv[i + 1];
+            i += 1;
+        } else {
+            std::cout << "輸入參數無效 (Invalid input): " << option << "\n";
+            return -1;
+        }
+    }
+    if (shard_count < 1 || shard_index < 0 || shard_index >= shard_count) {
+        std::cout << "分片參數無效 (Invalid shard): " << shard_index << " " << shard_count << "\n";
+        return -1;
+    }
+    if (max_in_flight_count < 1) {
+        std::cout << "max in flight 無效, 改設為1 (Invalid max in flight. Set to 1)\n";
+        max_in_flight_count = 1;
+    }
+    // Shards share the filenames on the command line, e.g. on a shared
+    // filesystem, so each shard writes its own results and cells files.
+    if (results_filename.empty()) {
+        results_filename = "results.jsonl";
+    }
+    results_filename = add_shard_suffix(results_filename, shard_index, shard_count);
+    if (!cells_filename.empty()) {
+        cells_filename = add_shard_suffix(cells_filename, shard_index, shard_count);
+    }
+
+    // Create the OCR backend if required.
+    std::unique_ptr<OcrBackend> ocr_backend;
+    if (!ocr_command.empty()) {
+        ocr_backend = std::make_unique<CommandOcrBackend>(ocr_command);
+    } else if (!ocr_worker_command.empty()) {
+        ocr_backend = std::make_unique<WorkerOcrBackend>(ocr_worker_command,
+            ocr_timeout_milliseconds);
+    } else if (!ocr_replay_directory.empty()) {
+        ocr_backend = std::make_unique<ReplayOcrBackend>(ocr_replay_directory,
+            ocr_latency_milliseconds);
+    }
+
+    // List images before creating any output file.
+    std::vector<std::string> image_names;
+    if (!list_image_filenames(image_directory, extension, image_names)) {
+        return -1;
+    }
+
+    // Create the cell writer if required.
+    std::unique_ptr<CellWriter> cell_writer;
+    if (!cells_filename.empty()) {
+        if (cells_format == "jsonl") {
+            cell_writer = std::make_unique<JsonLinesCellWriter>(cells_filename);
+        } else if (cells_format == "columnar") {
+            cell_writer = std::make_unique<ColumnarCellWriter>(cells_filename);
+        } else {
+            std::cout << "輸出格式無效 (Invalid cells format): " << cells_format << "\n";
+            return -1;
+        }
+        if (!cell_writer->is_open()) {
+            std::cout << "無法開啟輸出檔 (Cannot open output file): " << cells_filename << "\n";
+            return -1;
+        }
+    }
+
+    // Read settings.json, which is assumed to be located in the working directory.
+    const auto setting = read_settings("./settings.json");
+
+    std::ofstream results_file(results_filename);
+    if (!results_file.is_open()) {
+        std::cout << "無法開啟結果檔 (Cannot open results file): " << results_filename << "\n";
+        return -1;
+    }
+    std::cout << "分片 (Shard) " << shard_index << "/" << shard_count
+              << ", 結果檔 (Results file): " << results_filename << "\n";
+
+    // Images waiting to be parsed, in the order of image names.
+    // An image has a valid OCR result if it is sent to OCR.
+    struct PendingImage {
+        std::string image_name;
+        std::string image_filename;
+        std::future<bool> ocr_result;
+    };
+    std::deque<PendingImage> pending_images;
+
+    // Parse images of this shard. The workspace is shared by all images.
+    LineDetectionWorkspace line_detection_workspace;
+    int processed_count = 0;
+    int failed_count = 0;
+    auto parse_front_image = [&]() {
+        auto pending_image = std::move(pending_images.front());
+        pending_images.pop_front();
+
+        // Wait for OCR.
+        bool succeeded = true;
+        if (pending_image.ocr_result.valid() && !pending_image.ocr_result.get()) {
+            std::cout << "OCR失敗 (OCR failed): " << pending_image.image_name << "\n";
+            succeeded = false;
+        }
+
+        std::cout << "處理 (Process) " << pending_image.image_name << "\n";
+        std::vector<ParagraphGroup> paragraph_rows;
+        succeeded = succeeded && read_paragraph_rows(pending_image.image_filename, setting,
+            line_detection_workspace, paragraph_rows);
+        std::vector<Table> tables;
+        if (succeeded) {
+            tables = extract_tables(paragraph_rows);
+        } else {
+            ++failed_count;
+        }
+
+        // Write the record immediately, so that the results are kept
+        // if the shard is interrupted.
+        results_file << make_result_record(pending_image.image_name, succeeded, tables).dump() << "\n";
+        results_file.flush();
+        if (cell_writer) {
+            cell_writer->write(pending_image.image_name, get_cells(tables));
+        }
+        ++processed_count;
+    };
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (auto&& image_name : image_names) {
+        if (stable_hash(image_name) % shard_count != shard_index) continue;
+
+        // Parse the oldest images to make room for the image.
+        while (pending_images.size() >= max_in_flight_count) {
+            parse_front_image();
+        }
+
+        PendingImage pending_image;
+        pending_image.image_name = image_name;
+        pending_image.image_filename = (std::filesystem::path(image_directory) / image_name).string();
+
+        // Send the image to OCR unless it has been processed,
+        // i.e. a corresponding json file exists.
+        auto json_filename = get_json_filename(pending_image.image_filename);
+        if (ocr_backend && !std::filesystem::exists(json_filename)) {
+            pending_image.ocr_result = std::async(std::launch::async,
+                [&ocr_backend, image_filename = pending_image.image_filename, json_filename]() {
+                    return ocr_backend->detect(image_filename, json_filename);
+                });
+        }
+        pending_images.push_back(std::move(pending_image));
+    }
+    while (!pending_images.empty()) {
+        parse_front_image();
+    }
+    std::chrono::duration<double> elapsed_time = std::chrono::steady_clock::now() - start_time;
+
+    std::cout << "完成 " << processed_count << " 張圖, 失敗 " << failed_count << " 張 "
+              << "(Processed " << processed_count << " images, " << failed_count << " failed)\n"
+              << "耗時 (Elapsed) " << elapsed_time.count() << " s, "
+              << processed_count / std::max(elapsed_time.count(), 1e-9) << " images/s\n";
+    return 0;
+}
+
+/**
+ * img_parser merge <image_directory> <extension> <output_filename> <results_filename>...
+ * Combine results files of shards into one output ordered by image name,
+ * and report the images in the directory that are missing or failed.
+ * Each results file is sorted by image name as written by batch, so the
+ * files are merged while they are read and only one record of each file
+ * is kept in memory.
+ * @return 0 if all images succeeded, 1 if some are missing or failed.
+ */
+int run_merge(int argc, char** argv) {
+    // Parse input arguments.
+    if (argc < 6) {
+        std::cout << "輸入參數無效 (Invalid input). 用法 (Usage): img_parser merge "
+                  << "<image_directory> <extension> <output_filename> <results_filename>...\n";
+        return -1;
+    }
+    std::string image_directory = argv[2];
+    std::string extension = argv[3];
+    std::string output_filename = argv[4];
+
+    // Open results files of all shards.
+    std::vector<std::string> results_filenames(argv + 5, argv + argc);
+    std::vector<ResultsFileReader> readers;
+    readers.reserve(results_filenames.size());
+    for (auto&& results_filename : results_filenames) {
+        readers.emplace_back(results_filename);
+        if (!readers.back().is_open()) {
+            std::cout << "無法開啟結果檔 (Cannot open results file): " << results_filename << "\n";
+            return -1;
+        }
+    }
+
+    // List images before creating the output file, so that a missing
+    // directory is not reported as a complete merge.
+    std::vector<std::string> image_names;
+    if (!list_image_filenames(image_directory, extension, image_names)) {
+        return -1;
+    }
+
+    std::ofstream output_file(output_filename);
+    if (!output_file.is_open()) {
+        std::cout << "無法開啟輸出檔 (Cannot open output file): " << output_filename << "\n";
+        return -1;
+    }
+
+    // Write records in the order of image names. Records of images not in
+    // the directory are skipped. If an image appears more than once,
+    // e.g. a shard was rerun, a succeeded record is preferred.
+    std::vector<std::string> missing_names;
+    std::vector<std::string> failed_names;
+    for (auto&& image_name : image_names) {
+        bool found = false;
+        bool succeeded = false;
+        std::string record_line;
+        for (int i = 0; i < readers.size(); ++i) {
+            auto& reader = readers[i];
+            while (reader.has_next() && reader.get_image_name() < image_name) {
+                reader.next();
+            }
+            while (reader.has_next() && reader.get_image_name() == image_name) {
+                if (!found || !succeeded) {
+                    found = true;
+                    succeeded = reader.is_succeeded();
+                    record_line = reader.get_line();
+                }
+                reader.next();
+            }
+            if (!reader.is_sorted()) {
+                std::cout << "結果檔未依圖名排序 (Results file is not sorted by image name): "
+                          << results_filenames[i] << "\n";
+                return -1;
+            }
+        }
+        if (!found) {
+            missing_names.push_back(image_name);
+            continue;
+        }
+        if (!succeeded) {
+            failed_names.push_back(image_name);
+        }
+        output_file << record_line << "\n";
+    }
+
+    // Report.
+    std::cout << "缺少 " << missing_names.size() << " 張圖 (Missing " << missing_names.size() << " images):\n";
+    for (auto&& image_name : missing_names) {
+        std::cout << "  " << image_name << "\n";
+    }
+    std::cout << "失敗 " << failed_names.size() << " 張圖 (Failed " << failed_names.size() << " images):\n";
+    for (auto&& image_name : failed_names) {
+        std::cout << "  " << image_name << "\n";
+    }
+
+    return (missing_names.empty() && failed_names.empty()) ? 0 : 1;
+}
+
+/**
+ * img_parser inspect <image_filename> <output_filename>
+ * Write the intermediate and final results of an image as json:
+ * the text of each row, the best row range and its columns,
+ * and the row range and columns of all tables.
+ * The output is deterministic and is compared with golden outputs in tests.
+ */
+int run_inspect(int argc, char** argv) {
+    // Parse input arguments.
+    if (argc != 4) {
+        std::cout << "輸入參數無效 (Invalid input). 用法 (Usage): img_parser inspect "
+                  << "<image_filename> <output_filename>\n";
+        return -1;
+    }
+    std::string image_filename = argv[2];
+    std::string output_filename = argv[3];
+
+    // Read settings.json, which is assumed to be located in the working directory.
+    const auto setting = read_settings("./settings.json");
+
+    LineDetectionWorkspace line_detection_workspace;
+    std::vector<ParagraphGroup> paragraph_rows;
+    if (!read_paragraph_rows(image_filename, setting, line_detection_workspace, paragraph_rows)) {
+        return -1;
+    }
+
+    nlohmann::json output;
+
+    // Rows. Paragraphs in a row are sorted by x, so that the output does
+    // not depend on the order of paragraphs with the same min y.
+    output["rows"] = nlohmann::json::array();
+    for (auto row : paragraph_rows) {
+        row.sort(true);
+        nlohmann::json row_texts = nlohmann::json::array();
+        for (auto&& paragraph : row.get_paragraphs()) {
+            row_texts.push_back(paragraph.text);
+        }
+        output["rows"].push_back(row_texts);
+    }
+
+    // The best row range and its columns.
+    if (!paragraph_rows.empty()) {
+        auto best_row_range = find_best_row_range(paragraph_rows);
+        Table best_table;
+        best_table.row_begin_index = best_row_range.first;
+        best_table.row_end_index = best_row_range.second;
+        best_table.columns = split_columns(paragraph_rows, best_row_range.first, best_row_range.second);
+        output["best_table"] = make_result_record(image_filename, true, {best_table})["tables"][0];
+    }
+
+    // All tables.
+    output["tables"] = make_result_record(image_filename, true, extract_tables(paragraph_rows))["tables"];
+
+    std::ofstream output_file(output_filename);
+    if (!output_file.is_open()) {
+        std::cout << "無法開啟輸出檔 (Cannot open output file): " << output_filename << "\n";
+        return -1;
+    }
+    output_file << output.dump(2) << "\n";
+    return 0;
+}
+
+// The exit code of bench when it is skipped, registered in CTest.
+const int bench_skipped_code = 77;
+
+// The stage whose time is the unit of the baseline. Parsing the json file
+// is plain CPU work like the other stages, so the ratios of their times
+// hardly depend on the machine, and a baseline can be checked in.
+const std::string bench_reference_stage = "parse_json";
+
+/**
+ * img_parser bench <image_filename> <baseline_filename> [--tolerance <ratio>] [--repeat <count>]
+ *     [--record]
+ * Time each stage of processing an image. The minimum time of the
+ * repeats is divided by the time of the reference stage, and the ratio is
+ * compared with the baseline file. With --record, the ratios are written
+ * to the baseline file instead.
+ * @return 1 if a stage is slower than (1 + tolerance) times its baseline,
+ *   or bench_skipped_code if the baseline file does not exist.
+ */
+int run_bench(int argc, char** argv) {
+    // Parse input arguments.
+    if (argc < 4) {
+        std::cout << "輸入參數無效 (Invalid input). 用法 (Usage): img_parser bench "
+                  << "<image_filename> <baseline_filename> [--tolerance <ratio>] [--repeat <count>] "
+                  << "[--record]\n";
+        return -1;
+    }
+    std::string image_filename = argv[2];
+    std::string baseline_filename = argv[3];
+    double tolerance = 0.5;
+    int repeat_count = 20;
+    bool record_baseline = false;
+    for (int i = 4; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--tolerance" && i + 1 < argc) {
+            tolerance = std::atof(argv[i + 1]);
+            i += 1;
+        } else if (option == "--repeat" && i + 1 < argc) {
+            repeat_count = std::max(1, std::atoi(argv[i + 1]));
+            i += 1;
+        } else if (option == "--record") {
+            record_baseline = true;
+        } else {
+            std::cout << "輸入參數無效 (Invalid input): " << option << "\n";
+            return -1;
+        }
+    }
+
+    // Without a baseline there is nothing to compare with. Report the
+    // benchmark as skipped rather than passed.
+    nlohmann::json baseline;
+    if (!record_baseline) {
+        std::ifstream baseline_file(baseline_filename);
+        if (!baseline_file.is_open()) {
+            std::cout << "找不到基準檔, 略過 (No baseline file, skipped): " << baseline_filename << "\n"
+                      << "  請用 --record 記錄 (Record it with --record)\n";
+            return bench_skipped_code;
+        }
+        baseline = nlohmann::json::parse(baseline_file, nullptr, false);
+        if (baseline.is_discarded() || !baseline.contains("stage_ratios") ||
+            baseline.value("reference_stage", "") != bench_reference_stage) {
+            std::cout << "無法解析基準檔 (Cannot parse baseline file): " << baseline_filename << "\n";
+            return -1;
+        }
+    }
+
+    // Read settings.json, which is assumed to be located in the working directory.
+    const auto setting = read_settings("./settings.json");
+    auto json_filename = get_json_filename(image_filename);
+
+    // The minimum time of each stage in milliseconds.
+    std::map<std::string, double> stage_times;
+    auto record_time = [&stage_times](const std::string& stage,
+        std::chrono::steady_clock::time_point& start_time) {
+        auto end_time = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+        auto it = stage_times.find(stage);
+        if (it == stage_times.end() || time < it->second) {
+            stage_times[stage] = time;
+        }
+        start_time = end_time;
+    };
+
+    // Run all stages repeatedly. The workspace is reused as in batch mode.
+    LineDetectionWorkspace line_detection_workspace;
+    for (int i = 0; i < repeat_count; ++i) {
+        auto start_time = std::chrono::steady_clock::now();
+        if (!line_detection_workspace.decode_gray(image_filename)) {
+            std::cout << "無法開啟圖檔 (Cannot open image file): " << image_filename << "\n";
+            return -1;
+        }
+        record_time("decode", start_time);
+
+        nlohmann::json vision_result;
+        if (!read_vision_result(json_filename, vision_result)) {
+            return -1;
+        }
+        record_time("parse_json", start_time);
+
+        auto vertical_line_bbs = detect_vertical_lines(vision_result, setting,
+            line_detection_workspace);
+        record_time("detect_vertical_lines", start_time);
+
+        auto paragraph_group = read_paragraphs(vision_result, image_filename, vertical_line_bbs);
+        record_time("read_paragraphs", start_time);
+
+        auto paragraph_rows = split(paragraph_group, false);
+        record_time("split_rows", start_time);
+
+        if (!paragraph_rows.empty()) {
+            find_best_row_range(paragraph_rows);
+        }
+        record_time("find_best_row_range", start_time);
+
+        extract_tables(paragraph_rows);
+        record_time("extract_tables", start_time);
+    }
+
+    // Time of each stage relative to the reference stage.
+    double reference_time = stage_times[bench_reference_stage];
+    std::cout << "  " << bench_reference_stage << ": " << reference_time << " ms (reference)\n";
+    std::map<std::string, double> stage_ratios;
+    for (auto&& stage_time : stage_times) {
+        if (stage_time.first == bench_reference_stage) continue;
+        stage_ratios[stage_time.first] = stage_time.second / std::max(reference_time, 1e-9);
+    }
+
+    // Record the baseline if required.
+    if (record_baseline) {
+        std::ofstream output_file(baseline_filename);
+        if (!output_file.is_open()) {
+            std::cout << "無法開啟基準檔 (Cannot open baseline file): " << baseline_filename << "\n";
+            return -1;
+        }
+        nlohmann::json output;
+        output["reference_stage"] = bench_reference_stage;
+        output["stage_ratios"] = stage_ratios;
+        output_file << output.dump(2) << "\n";
+        std::cout << "記錄基準 (Record baseline): " << baseline_filename << "\n";
+        for (auto&& stage_ratio : stage_ratios) {
+            std::cout << "  " << stage_ratio.first << ": " << stage_times[stage_ratio.first] << " ms, "
+                      << "ratio " << stage_ratio.second << "\n";
+        }
+        return 0;
+    }
+
+    // Compare with the baseline. Differences within the timer noise
+    // of very fast stages are ignored. Stages missing in the baseline
+    // are not compared.
+    const double noise_time = 0.05;
+    const auto& baseline_ratios = baseline["stage_ratios"];
+    bool regressed = false;
+    for (auto&& stage_ratio : stage_ratios) {
+        auto& stage = stage_ratio.first;
+        double time = stage_times[stage];
+        double baseline_ratio = baseline_ratios.value(stage, 0.0);
+        double budget = baseline_ratio * reference_time * (1 + tolerance) + noise_time;
+        bool stage_regressed = baseline_ratios.contains(stage) && time > budget;
+        regressed = regressed || stage_regressed;
+        std::cout << "  " << stage << ": " << time << " ms, ratio " << stage_ratio.second << " ";
+        if (baseline_ratios.contains(stage)) {
+            std::cout << "(baseline ratio " << baseline_ratio << ", budget " << budget << " ms)"
+                      << (stage_regressed ? " REGRESSED" : "") << "\n";
+        } else {
+            std::cout << "(no baseline)\n";
+        }
+    }
+    return regressed ? 1 : 0;
+}
+
+/**
+ * img_parser convert-cells <columnar_filename> <jsonl_filename>
+ * Convert a cells file in the columnar format to JSON Lines,
+ * as written by batch with --cells-format jsonl.
+ */
+int run_convert_cells(int argc, char** argv) {
+    // Parse input arguments.
+    if (argc != 4) {
+        std::cout << "輸入參數無效 (Invalid input). 用法 (Usage): img_parser convert-cells "
+                  << "<columnar_filename> <jsonl_filename>\n";
+        return -1;
+    }
+    std::string columnar_filename = argv[2];
+    std::string jsonl_filename = argv[3];
+
+    ColumnarCellReader reader(columnar_filename);
+    if (!reader.is_valid()) {
+        std::cout << "無法讀取輸入檔 (Cannot read input file): " << columnar_filename << "\n";
+        return -1;
+    }
+    JsonLinesCellWriter writer(jsonl_filename);
+    if (!writer.is_open()) {
+        std::cout << "無法開啟輸出檔 (Cannot open output file): " << jsonl_filename << "\n";
+        return -1;
+    }
+
+    std::string image_name;
+    std::vector<Cell> cells;
+    while (reader.read(image_name, cells)) {
+        writer.write(image_name, cells);
+    }
+    if (reader.is_truncated()) {
+        std::cout << "輸入檔不完整 (Input file is truncated): " << columnar_filename << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // Run subcommands.
+    if (argc >= 2 && std::string(argv[1]) == "batch") {
+        return run_batch(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "merge") {
+        return run_merge(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "inspect") {
+        return run_inspect(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        return run_bench(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "convert-cells") {
+        return run_convert_cells(argc, argv);
+    }
+
+    // Parse input argument.
+    std::string image_filename;
+    bool extract_all_tables = false;
+    if (argc == 2) {
+        image_filename = argv[1];
+    } else if (argc == 3 && std::string(argv[2]) == "--all-tables") {
+        image_filename = argv[1];
+        extract_all_tables = true;
+    } else {
+        std::cout << "輸入參數無效 (Invalid input). "
+                  << "用法 (Usage): img_parser <image_filename> [--all-tables]\n";
+        return -1;
+    }
+
+    // Read settings.json, which is assumed to be located in the working directory.
+    const auto setting = read_settings("./settings.json");
+
+    // Read paragraphs and split them into rows.
+    LineDetectionWorkspace line_detection_workspace;
+    std::vector<ParagraphGroup> paragraph_rows;
+    if (!read_paragraph_rows(image_filename, setting, line_detection_workspace, paragraph_rows)) {
+        return -1;
+    }
+
+    // std::cout << "\nRow count: " << paragraph_rows.size() << "\n\n";
+    // for (int i = 0; i < paragraph_rows.size(); ++i) {
+    //     std::cout << "Row " << i << ":\n\n";
+    //     print(paragraph_rows[i]);
+    //     std::cout << "\n";
+    // }
+
+    // Extract all tables without asking for a row range.
+    if (extract_all_tables) {
+        auto tables = extract_tables(paragraph_rows);
+        std::cout << "找到 " << tables.size() << " 個表格 "
+                  << "(Found " << tables.size() << " tables)\n";
+        for (int i = 0; i < tables.size(); ++i) {
+            auto& table = tables[i];
+            std::cout << "\n表格 " << i << ": 範圍 [" << table.row_begin_index << ", " << table.row_end_index << ") "
+                      << "(Table " << i << ": range [" << table.row_begin_index << ", " << table.row_end_index << ")):\n";
+            for (auto&& column : table.columns) {
+                std::cout << "\n";
+                print(column);
+            }
+        }
+        return 0;
+    }
+
+    // Show images with rows labelled.
+    // The image is kept to be shown again in the session.
+    cv::Mat image = cv::imread(image_filename);
+    show_image(image, paragraph_rows, setting);
+
+    // Let user input row ranges until quitting. The rows are kept in memory,
+    // and the columns of each row range are computed only once.
+    ColumnSplitCache column_split_cache(paragraph_rows);
+    bool best_row_range_is_found = false;
+    std::pair<int, int> best_row_range;
+    while (true) {
+        std::cout << "\n輸入 q 結束, 輸入 s 顯示圖片 (Input q to quit, s to show the image)\n";
+        std::string input_row_begin_text;
+        std::string input_row_end_text;
+        std::cout << "請輸入起始列 (Please input row begin index): ";
+        if (!(std::cin >> input_row_begin_text) || input_row_begin_text == "q") break;
+        if (input_row_begin_text == "s") {
+            show_image(image, paragraph_rows, setting);
+            continue;
+        }
+        std::cout << "請輸入結束列 (Please input row end index): ";
+        if (!(std::cin >> input_row_end_text) || input_row_end_text == "q") break;
+
+        // Check input valid or not.
+        int input_row_begin_index = -1;
+        int input_row_end_index = -1;
+        std::istringstream(input_row_begin_text) >> input_row_begin_index;
+        std::istringstream(input_row_end_text) >> input_row_end_index;
+        bool row_range_is_specified_by_input = true;
+        if (input_row_begin_index < 0 || input_row_end_index < 1 ||
+            input_row_begin_index >= paragraph_rows.size() || input_row_end_index > paragraph_rows.size() ||
+            input_row_begin_index >= input_row_end_index) {
+            std::cout << "輸入範圍無效, 嘗試自動尋找最佳範圍 "
+                      << "(Invalid input indices. Try to find the best row range.)\n";
+            row_range_is_specified_by_input = false;
+        }
+
+        // Determine the row range to use.
+        int row_begin_index, row_end_index;
+        if (row_range_is_specified_by_input) {
+            // The row range is specified by user input.
+            row_begin_index = input_row_begin_index;
+            row_end_index = input_row_end_index;
+        } else {
+            // The row range is not specified by user input.
+            // Find best row range that maximizes the column count, only once.
+            if (paragraph_rows.empty()) {
+                std::cout << "找不到任何列 (No rows are found.)\n";
+                continue;
+            }
+            if (!best_row_range_is_found) {
+                best_row_range = find_best_row_range(paragraph_rows);
+                best_row_range_is_found = true;
+            }
+            row_begin_index = best_row_range.first;
+            row_end_index = best_row_range.second;
+        }
+
+        std::cout << "將範圍 [" << row_begin_index << ", " << row_end_index << ") 內的列分割為行 "
+                  << "(Split rows in range [" << row_begin_index << ", " << row_end_index << ") into columns):\n";
+
+        // Merge rows in the range and split them into columns.
+        auto& paragraph_columns = column_split_cache.get_columns(row_begin_index, row_end_index);
+
+        // Print columns.
+        // std::cout << "\nColumn count: " << paragraph_columns.size() << "\n\n";
+        for (int i = 0; i < paragraph_columns.size(); ++i) {
+            std::cout << "\n";
+            print(paragraph_columns[i]);
+        }
     }
 
     // // Find the row of column titles.
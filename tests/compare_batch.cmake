@@ -0,0 +1,66 @@
+# Run "img_parser batch" on several fixtures of different sizes, with OCR
+# replayed and overlapped with parsing, and check that the tables of each
+# image equal the tables of "img_parser inspect" on the image alone.
+# Images are processed in the order of FIXTURES, so that a smaller image
+# follows a larger one and reuses its line detection workspace.
+# Variables: IMG_PARSER, FIXTURE_DIR, FIXTURES (names of png fixtures), WORK_DIR.
+cmake_minimum_required(VERSION 3.21) # string(JSON), file(COPY_FILE)
+
+set(IMAGE_DIR ${WORK_DIR}/images)
+set(REPLAY_DIR ${WORK_DIR}/replay)
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${IMAGE_DIR} ${REPLAY_DIR})
+
+# Prefix the names with their order, since batch processes images by name.
+set(IMAGE_NAMES)
+set(INDEX 0)
+foreach(FIXTURE ${FIXTURES})
+    math(EXPR INDEX "${INDEX} + 1")
+    set(IMAGE_NAME ${INDEX}_${FIXTURE})
+    file(COPY_FILE ${FIXTURE_DIR}/${FIXTURE}.png ${IMAGE_DIR}/${IMAGE_NAME}.png)
+    file(COPY_FILE ${FIXTURE_DIR}/${FIXTURE}.json ${REPLAY_DIR}/${IMAGE_NAME}.json)
+    list(APPEND IMAGE_NAMES ${IMAGE_NAME})
+endforeach()
+
+execute_process(COMMAND ${IMG_PARSER} batch ${IMAGE_DIR} png
+        --output ${WORK_DIR}/results.jsonl
+        --ocr-replay ${REPLAY_DIR} --ocr-latency 20 --max-in-flight 2
+    RESULT_VARIABLE batch_result)
+if(NOT batch_result EQUAL 0)
+    message(FATAL_ERROR "img_parser batch failed")
+endif()
+
+file(STRINGS ${WORK_DIR}/results.jsonl RECORDS ENCODING UTF-8)
+list(LENGTH RECORDS RECORD_COUNT)
+list(LENGTH IMAGE_NAMES IMAGE_COUNT)
+if(NOT RECORD_COUNT EQUAL IMAGE_COUNT)
+    message(FATAL_ERROR "Expected ${IMAGE_COUNT} records, got ${RECORD_COUNT}")
+endif()
+
+set(INDEX 0)
+foreach(IMAGE_NAME ${IMAGE_NAMES})
+    list(GET RECORDS ${INDEX} RECORD)
+    math(EXPR INDEX "${INDEX} + 1")
+    string(JSON RECORD_IMAGE GET ${RECORD} image)
+    string(JSON RECORD_STATUS GET ${RECORD} status)
+    if(NOT RECORD_IMAGE STREQUAL "${IMAGE_NAME}.png" OR NOT RECORD_STATUS STREQUAL "ok")
+        message(FATAL_ERROR "Unexpected record of ${IMAGE_NAME}: ${RECORD}")
+    endif()
+
+    # The vision result was written next to the image by the replay backend.
+    set(INSPECT_OUTPUT ${WORK_DIR}/${IMAGE_NAME}.inspect.json)
+    execute_process(COMMAND ${IMG_PARSER} inspect ${IMAGE_DIR}/${IMAGE_NAME}.png ${INSPECT_OUTPUT}
+        RESULT_VARIABLE inspect_result)
+    if(NOT inspect_result EQUAL 0)
+        message(FATAL_ERROR "img_parser inspect failed on ${IMAGE_NAME}")
+    endif()
+    file(READ ${INSPECT_OUTPUT} INSPECT)
+
+    string(JSON BATCH_TABLES GET ${RECORD} tables)
+    string(JSON INSPECT_TABLES GET ${INSPECT} tables)
+    string(JSON TABLES_EQUAL EQUAL ${BATCH_TABLES} ${INSPECT_TABLES})
+    if(NOT TABLES_EQUAL)
+        message(FATAL_ERROR "Tables of ${IMAGE_NAME} in batch differ from inspect:\n"
+            "batch: ${BATCH_TABLES}\ninspect: ${INSPECT_TABLES}")
+    endif()
+endforeach()
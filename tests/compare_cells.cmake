@@ -0,0 +1,32 @@
+# Run "img_parser batch" on the fixtures with cells written in both formats,
+# and compare them with the golden outputs. The columnar file is also read
+# back with "img_parser convert-cells" and must match the JSON Lines output.
+# Variables: IMG_PARSER, FIXTURE_DIR, EXTENSION, EXPECTED_JSONL, EXPECTED_COLUMNAR, OUTPUT_DIR.
+function(check_files actual expected)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${actual} ${expected}
+        RESULT_VARIABLE compare_result)
+    if(NOT compare_result EQUAL 0)
+        message(FATAL_ERROR "Output ${actual} differs from golden output ${expected}")
+    endif()
+endfunction()
+
+foreach(FORMAT jsonl columnar)
+    execute_process(COMMAND ${IMG_PARSER} batch ${FIXTURE_DIR} ${EXTENSION}
+            --output ${OUTPUT_DIR}/cells_results.jsonl
+            --cells ${OUTPUT_DIR}/cells.${FORMAT} --cells-format ${FORMAT}
+        RESULT_VARIABLE batch_result)
+    if(NOT batch_result EQUAL 0)
+        message(FATAL_ERROR "img_parser batch failed with cells format ${FORMAT}")
+    endif()
+endforeach()
+
+check_files(${OUTPUT_DIR}/cells.jsonl ${EXPECTED_JSONL})
+check_files(${OUTPUT_DIR}/cells.columnar ${EXPECTED_COLUMNAR})
+
+execute_process(COMMAND ${IMG_PARSER} convert-cells ${OUTPUT_DIR}/cells.columnar
+        ${OUTPUT_DIR}/cells.converted.jsonl
+    RESULT_VARIABLE convert_result)
+if(NOT convert_result EQUAL 0)
+    message(FATAL_ERROR "img_parser convert-cells failed")
+endif()
+check_files(${OUTPUT_DIR}/cells.converted.jsonl ${EXPECTED_JSONL})
@@ -0,0 +1,13 @@
+# Run "img_parser inspect" on an image and compare the output with the golden output.
+# Variables: IMG_PARSER, IMAGE, EXPECTED, OUTPUT.
+execute_process(COMMAND ${IMG_PARSER} inspect ${IMAGE} ${OUTPUT}
+    RESULT_VARIABLE inspect_result)
+if(NOT inspect_result EQUAL 0)
+    message(FATAL_ERROR "img_parser inspect failed on ${IMAGE}")
+endif()
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${OUTPUT} ${EXPECTED}
+    RESULT_VARIABLE compare_result)
+if(NOT compare_result EQUAL 0)
+    message(FATAL_ERROR "Output ${OUTPUT} differs from golden output ${EXPECTED}")
+endif()
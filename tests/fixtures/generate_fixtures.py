@@ -0,0 +1,166 @@
+'''
+Generate the synthetic poster fixtures of the regression tests:
+an image with ruled vertical lines and its vision result <name>.json.
+The golden outputs <name>.expected.json are written by
+"img_parser inspect", not by this script.
+'''
+import json
+import struct
+import zlib
+
+def write_pgm(filename, width, height, pixels):
+    with open(filename, 'wb') as image_file:
+        image_file.write(b'P5\n%d %d\n255\n' % (width, height) + bytes(pixels))
+
+def write_png(filename, width, height, pixels):
+    '''
+    Write an 8-bit grayscale PNG.
+    '''
+    def chunk(chunk_type, data):
+        return (struct.pack('>I', len(data)) + chunk_type + data +
+            struct.pack('>I', zlib.crc32(chunk_type + data) & 0xffffffff))
+    raw = b''.join(b'\x00' + bytes(pixels[y * width:(y + 1) * width])
+        for y in range(height))
+    with open(filename, 'wb') as image_file:
+        image_file.write(b'\x89PNG\r\n\x1a\n')
+        image_file.write(chunk(b'IHDR', struct.pack('>IIBBBBB', width, height, 8, 0, 0, 0, 0)))
+        image_file.write(chunk(b'IDAT', zlib.compress(raw, 9)))
+        image_file.write(chunk(b'IEND', b''))
+
+def draw_vertical_line(pixels, width, x, y_begin, y_end, thickness=2):
+    for y in range(y_begin, y_end + 1):
+        for dx in range(thickness):
+            pixels[y * width + x + dx] = 0
+
+def symbols(text, x_begin, y_begin, x_end, y_end):
+    '''
+    Split a box evenly into symbols, one per character.
+    '''
+    symbol_width = (x_end - x_begin) / len(text)
+    out_symbols = []
+    for i, character in enumerate(text):
+        x0 = int(x_begin + i * symbol_width)
+        x1 = int(x_begin + (i + 1) * symbol_width)
+        out_symbols.append({'text': character, 'boundingBox': {'vertices': [
+            {'x': x0, 'y': y_begin}, {'x': x1, 'y': y_begin},
+            {'x': x1, 'y': y_end}, {'x': x0, 'y': y_end}]}})
+    return out_symbols
+
+def paragraph(*words):
+    '''
+    Each word is (text, x_begin, y_begin, x_end, y_end).
+    '''
+    return {'words': [{'symbols': symbols(*word)} for word in words]}
+
+def write_vision_result(filename, paragraphs):
+    vision_result = {'fullTextAnnotation': {'pages': [{'blocks': [{'paragraphs': paragraphs}]}]}}
+    with open(filename, 'w') as json_file:
+        json.dump(vision_result, json_file, ensure_ascii=False)
+
+def two_tables_pixels():
+    width, height = 240, 200
+    pixels = bytearray([255] * (width * height))
+    for x in (5, 80, 160, 234):
+        draw_vertical_line(pixels, width, x, 25, 115)
+    for x in (5, 120, 234):
+        draw_vertical_line(pixels, width, x, 135, 195)
+    return width, height, pixels
+
+TABLE_1_ROWS = [('日期', '時間', '地點'), ('7/1', '10:00-11:00', '全聯福利中心'),
+    ('7/2', '14:00-15:30', '市立圖書館'), ('7/3', '09:00-09:30', '第一市場')]
+TABLE_1_CELLS = [(10, 70), (90, 150), (170, 230)]
+TABLE_2_ROWS = [('日期', '地點'), ('7/4', '火車站'), ('7/5', '夜市')]
+TABLE_2_CELLS = [(10, 110), (130, 230)]
+
+def two_tables_paragraphs(merge_cells):
+    '''
+    If merge_cells, the first two cells of the data rows are read by OCR as
+    one paragraph across the ruled line between them, which must be split
+    by the detected line.
+    '''
+    paragraphs = [paragraph(('確診者足跡', 60, 5, 180, 15))]
+    for rows, cells, y_begin, row_height in ((TABLE_1_ROWS, TABLE_1_CELLS, 30, 22),
+        (TABLE_2_ROWS, TABLE_2_CELLS, 140, 20)):
+        for row_index, row in enumerate(rows):
+            y = y_begin + row_index * row_height
+            words = [(text, x0, y, x1, y + 12) for (x0, x1), text in zip(cells, row)]
+            if merge_cells and row_index > 0:
+                paragraphs.append(paragraph(words[0], words[1]))
+                words = words[2:]
+            paragraphs.extend(paragraph(word) for word in words)
+        if rows is TABLE_1_ROWS:
+            paragraphs.append(paragraph(('以下為第二位確診者', 20, 120, 200, 130)))
+    return paragraphs
+
+def generate_two_tables():
+    width, height, pixels = two_tables_pixels()
+    write_pgm('two_tables.pgm', width, height, pixels)
+    write_vision_result('two_tables.json', two_tables_paragraphs(False))
+
+def generate_crossing_line():
+    width, height, pixels = two_tables_pixels()
+    write_png('crossing_line.png', width, height, pixels)
+    write_vision_result('crossing_line.json', two_tables_paragraphs(True))
+
+def generate_large_table():
+    '''
+    A poster at a real resolution with a long table, sized so that
+    every stage takes well above the timer noise.
+    '''
+    width, height = 1240, 3508
+    pixels = bytearray([255] * (width * height))
+    column_xs = (20, 320, 620, 920, 1218)
+    row_count = 100
+    row_height = 24
+    y_begin = 120
+    y_end = y_begin + row_count * row_height
+    for x in column_xs:
+        draw_vertical_line(pixels, width, x, y_begin - 10, y_end + 10, 3)
+    write_png('large_table.png', width, height, pixels)
+
+    paragraphs = [paragraph(('確診者足跡列表', 400, 40, 840, 80))]
+    for row_index in range(row_count):
+        y = y_begin + row_index * row_height
+        row = ('%d/%d' % (row_index % 12 + 1, row_index % 28 + 1),
+            '%02d:00' % (row_index % 24),
+            '地點%d' % row_index, '備註%d' % (row_index % 7))
+        for column_index, text in enumerate(row):
+            x0 = column_xs[column_index] + 20
+            x1 = x0 + 16 * len(text)
+            paragraphs.append(paragraph((text, x0, y, x1, y + 16)))
+    paragraphs.append(paragraph(('資料來源: 衛生局', 40, y_end + 40, 400, y_end + 60)))
+    write_vision_result('large_table.json', paragraphs)
+
+def generate_footer_table():
+    '''
+    A poster smaller than large_table with a footer close to the bottom,
+    across the x of the ruled lines of large_table. In batch mode it must
+    give the same output after large_table as on its own.
+    '''
+    width, height = 600, 400
+    pixels = bytearray([255] * (width * height))
+    column_xs = (20, 220, 420, 578)
+    row_count = 8
+    row_height = 30
+    y_begin = 60
+    y_end = y_begin + row_count * row_height
+    for x in column_xs:
+        draw_vertical_line(pixels, width, x, y_begin - 10, y_end, 2)
+    write_png('footer_table.png', width, height, pixels)
+
+    paragraphs = [paragraph(('確診者足跡', 220, 15, 380, 35))]
+    for row_index in range(row_count):
+        y = y_begin + row_index * row_height
+        row = ('7/%d' % (row_index + 1), '%02d:00' % (row_index + 9), '地點%d' % row_index)
+        for column_index, text in enumerate(row):
+            x0 = column_xs[column_index] + 20
+            x1 = x0 + 16 * len(text)
+            paragraphs.append(paragraph((text, x0, y, x1, y + 16)))
+    paragraphs.append(paragraph(('資料來源衛生局請民眾自主健康管理', 40, 376, 560, 392)))
+    write_vision_result('footer_table.json', paragraphs)
+
+if __name__ == '__main__':
+    generate_two_tables()
+    generate_crossing_line()
+    generate_large_table()
+    generate_footer_table()
@@ -0,0 +1,37 @@
+// A long-lived OCR worker for "img_parser batch --ocr-worker".
+// Read one image filename per line from stdin, detect text with one
+// Vision client shared by all images, write the result to a JSON file
+// next to the image, and reply "ok\t<imageFilename>" or
+// "error\t<imageFilename>" on stdout. Logs go to stderr, since stdout
+// carries the replies.
+const fs = require('fs');
+const readline = require('readline');
+const vision = require('@google-cloud/vision');
+
+// Create one client for all images.
+const client = new vision.ImageAnnotatorClient();
+
+function reply(status, imageFilename) {
+  process.stdout.write(status + '\t' + imageFilename + '\n');
+}
+
+async function detectText(imageFilename) {
+  const outputFilename = imageFilename.substring(0, imageFilename.lastIndexOf('.') + 1) + 'json';
+  try {
+    const [result] = await client.documentTextDetection(imageFilename);
+    fs.writeFileSync(outputFilename, JSON.stringify(result));
+    reply('ok', imageFilename);
+  } catch (err) {
+    console.error(imageFilename + ': ' + err);
+    reply('error', imageFilename);
+  }
+}
+
+// Requests are handled concurrently. The number of requests in flight
+// is limited by the sender.
+const lines = readline.createInterface({ input: process.stdin });
+lines.on('line', imageFilename => {
+  if (imageFilename.length > 0) {
+    detectText(imageFilename);
+  }
+});